@@ -194,10 +194,10 @@ public:
 	virtual action take_action(const board &before)
 	{
 		std::shuffle(opcode.begin(), opcode.end(), engine);
+		auto after = before.afterstates();
 		for (int op : opcode)
 		{
-			board::reward reward = board(before).slide(op);
-			if (reward != -1)
+			if (after[op].legal())
 				return action::slide(op);
 		}
 		return action();
@@ -219,9 +219,10 @@ public:
 	{
 		board::reward maxReward = INT_MIN;
 		int index = 0;
+		auto after = before.afterstates();
 
 		for(int i = 0; i < 4; i++){
-			board::reward rwd = board(before).slide(i);
+			board::reward rwd = after[i].score;
 			if(maxReward < rwd){
 				maxReward = rwd;
 				index = i;
@@ -249,14 +250,15 @@ public:
 		board::reward maxFirstReward = INT_MIN;
 		int index = 0;
 
+		auto first = before.afterstates();
+
 		for(int i = 0; i < 4; i++){
-			board board1 = board(before);
-			board::reward FirstReward = board1.slide(i);
+			board::reward FirstReward = first[i].score;
 			board::reward maxSecondReward = INT_MIN;	
 
+			auto second = first[i].after.afterstates();
 			for(int j = 0; j < 4; j++){
-				board board2 = board(board1);
-				maxSecondReward = max(maxSecondReward, board2.slide(j));
+				maxSecondReward = max(maxSecondReward, second[j].score);
 			}
 
 			if(maxSecondReward + FirstReward > maxFirstReward){
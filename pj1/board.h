@@ -12,7 +12,36 @@
 #include <iostream>
 #include <iomanip>
 #include <algorithm>
-#include <cmath>
+#include <cctype>
+#include <iterator>
+
+/**
+ * lookup tables of the tile face and the tile score for each tile index
+ *
+ * index: 0  1  2  3  4  5   6   7   8    9    10    11     12     13      14
+ * face:  0  1  2  3  6  12  24  48  96   192  384   768    1536   3072    6144
+ * score: 0  0  0  3  9  27  81  243 729  2187 6561  19683  59049  177147  531441
+ *
+ * the tables are checked against the closed forms at compile time, i.e.,
+ * face = 3 * 2^(index - 3) and score = 3^(index - 2) for index >= 3
+ */
+template<typename = void>
+struct tile_table {
+	static constexpr unsigned face[16] = {
+		0, 1, 2, 3, 6, 12, 24, 48, 96, 192, 384, 768, 1536, 3072, 6144, 12288 };
+	static constexpr unsigned score[16] = {
+		0, 0, 0, 3, 9, 27, 81, 243, 729, 2187, 6561, 19683, 59049, 177147, 531441, 1594323 };
+
+	static constexpr unsigned face_of(unsigned i) { return i >= 3 ? 3u << (i - 3) : i; }
+	static constexpr unsigned pow3(unsigned n) { return n ? 3 * pow3(n - 1) : 1; }
+	static constexpr unsigned score_of(unsigned i) { return i >= 3 ? pow3(i - 2) : 0; }
+	static constexpr bool verify(unsigned i = 0) {
+		return i >= 16 || (face[i] == face_of(i) && score[i] == score_of(i) && verify(i + 1));
+	}
+};
+template<typename T> constexpr unsigned tile_table<T>::face[16];
+template<typename T> constexpr unsigned tile_table<T>::score[16];
+static_assert(tile_table<>::verify(), "tile tables mismatch the closed forms");
 
 /**
  * array-based board for Threes!
@@ -23,12 +52,19 @@
  *  (8)  (9) (10) (11)
  * (12) (13) (14) (15)
  *
+ * define THREES_PACKED_BOARD to use the packed backend instead, which stores
+ * the tile index of cell (i) in the i-th 4-bit nibble of a single 64-bit word
+ * so that copying a board costs 16 bytes instead of 72 bytes
  */
 class board {
 public:
 	typedef uint32_t cell;
+#if defined(THREES_PACKED_BOARD)
+	typedef uint64_t grid;
+#else
 	typedef std::array<cell, 4> row;
 	typedef std::array<row, 4> grid;
+#endif
 	typedef uint64_t data;
 	typedef uint64_t score;
 	typedef int reward;
@@ -41,6 +77,50 @@ public:
 
 	operator grid&() { return tile; }
 	operator const grid&() const { return tile; }
+
+#if defined(THREES_PACKED_BOARD)
+	/**
+	 * reference to a single nibble of a packed board
+	 */
+	class cell_ref {
+	public:
+		cell_ref(grid& raw, unsigned i) : raw(raw), i(i) {}
+		operator cell() const { return (raw >> (i << 2)) & 0x0fu; }
+		cell_ref& operator =(cell t) { raw = (raw & ~(grid(0x0fu) << (i << 2))) | (grid(t & 0x0fu) << (i << 2)); return *this; }
+		cell_ref& operator =(const cell_ref& t) { return operator =(cell(t)); }
+	private:
+		grid& raw;
+		unsigned i;
+	};
+
+	/**
+	 * read-only iterator over the 16 cells of a packed board
+	 */
+	class const_iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef cell value_type;
+		typedef std::ptrdiff_t difference_type;
+		typedef const cell* pointer;
+		typedef cell reference;
+
+		const_iterator(grid raw = 0, unsigned i = 0) : raw(raw), i(i) {}
+		cell operator *() const { return (raw >> (i << 2)) & 0x0fu; }
+		const_iterator& operator ++() { i++; return *this; }
+		const_iterator operator ++(int) { const_iterator it = *this; i++; return it; }
+		bool operator ==(const const_iterator& it) const { return i == it.i; }
+		bool operator !=(const const_iterator& it) const { return i != it.i; }
+	private:
+		grid raw;
+		unsigned i;
+	};
+
+	cell_ref operator ()(unsigned i) { return cell_ref(tile, i); }
+	cell operator ()(unsigned i) const { return (tile >> (i << 2)) & 0x0fu; }
+
+	const_iterator begin() const { return const_iterator(tile, 0); }
+	const_iterator end() const { return const_iterator(tile, 16); }
+#else
 	row& operator [](unsigned i) { return tile[i]; }
 	const row& operator [](unsigned i) const { return tile[i]; }
 	cell& operator ()(unsigned i) { return tile[i / 4][i % 4]; }
@@ -50,6 +130,7 @@ public:
 	const cell* begin() const { return &(operator()(0)); }
 	cell* end() { return begin() + 16; }
 	const cell* end() const { return begin() + 16; }
+#endif
 
 	data info() const { return attr; }
 	data info(data dat) { data old = attr; attr = dat; return old; }
@@ -59,10 +140,10 @@ private:
 	data info4(size_t i, data dat) { data old = info4(i); info(info() ^ ((old ^ dat) << (4 * i))); return old; }
 
 public:
-	static unsigned itot(unsigned i) { return i >= 3 ? 3 * (1 << (i - 3)) : i; }
-	static unsigned ttoi(unsigned t) { return t >= 3 ? std::log2(t / 3) + 3 : t; }
-	static unsigned itov(unsigned i) { return ttov(itot(i)); }
-	static unsigned ttov(unsigned t) { return t >= 3 ? std::pow(3, std::log2(t / 3) + 1) : 0; }
+	static unsigned itot(unsigned i) { return tile_table<>::face[i & 0x0fu]; }
+	static unsigned ttoi(unsigned t) { return t >= 3 ? __builtin_ctz(t / 3) + 3 : t; }
+	static unsigned itov(unsigned i) { return tile_table<>::score[i & 0x0fu]; }
+	static unsigned ttov(unsigned t) { return itov(ttoi(t)); }
 
 	cell hint() const { return info4(0); }
 	cell hint(cell t) { return info4(0, t); }
@@ -133,11 +214,60 @@ public:
 		return r;
 	}
 
-	reward slide_left() {
+	/**
+	 * compute the afterstates of all the four slides (indexed by opcode) in one pass,
+	 * which looks up each row and each column only once for both directions
+	 */
+	struct afterstate;
+	std::array<afterstate, 4> afterstates() const;
+
+	reward slide_left() { return slide_rows(lookup::table().left); }
+	reward slide_right() { return slide_rows(lookup::table().right); }
+	reward slide_up() { return slide_columns(lookup::table().left); }
+	reward slide_down() { return slide_columns(lookup::table().right); }
+
+	/**
+	 * reference implementation of slide, which walks each row cell by cell
+	 * and reflects/rotates the whole board for the other directions
+	 * it is only used to build and verify the lookup tables
+	 */
+	reward slide_reference(unsigned opcode) {
+		reward score = -1;
+		switch (opcode & 0b11) {
+		case 0:
+			rotate_clockwise();
+			reflect_horizontal();
+			score = slide_left_reference();
+			reflect_horizontal();
+			rotate_counterclockwise();
+			break;
+		case 1:
+			reflect_horizontal();
+			score = slide_left_reference();
+			reflect_horizontal();
+			break;
+		case 2:
+			rotate_clockwise();
+			score = slide_left_reference();
+			rotate_counterclockwise();
+			break;
+		case 3:
+			score = slide_left_reference();
+			break;
+		}
+		return score;
+	}
+
+	reward slide_left_reference() {
 		bool moved = false;
 		reward score = 0;
 		for (int r = 0; r < 4; r++) {
+#if defined(THREES_PACKED_BOARD)
+			cell row[4];
+			for (int c = 0; c < 4; c++) row[c] = operator()(r * 4 + c);
+#else
 			auto& row = tile[r];
+#endif
 			for (int c = 1; c < 4; c++) {
 				auto& t0 = row[c - 1];
 				auto& t1 = row[c];
@@ -152,28 +282,141 @@ public:
 					moved = true;
 				}
 			}
+#if defined(THREES_PACKED_BOARD)
+			for (int c = 0; c < 4; c++) operator()(r * 4 + c) = row[c];
+#endif
 		}
 		return (moved) ? score : -1;
 	}
-	reward slide_right() {
-		reflect_horizontal();
-		reward score = slide_left();
-		reflect_horizontal();
-		return score;
+
+public:
+	/**
+	 * get/set a row (or a column) in its 16-bit packed form,
+	 * where the i-th nibble holds the i-th cell from the left (or the top)
+	 */
+#if defined(THREES_PACKED_BOARD)
+	unsigned fetch_row(unsigned r) const {
+		return (tile >> (r << 4)) & 0xffffu;
 	}
-	reward slide_up() {
-		rotate_clockwise();
-		reward score = slide_right();
-		rotate_counterclockwise();
-		return score;
+	void place_row(unsigned r, unsigned v) {
+		tile = (tile & ~(grid(0xffffu) << (r << 4))) | (grid(v & 0xffffu) << (r << 4));
 	}
-	reward slide_down() {
-		rotate_clockwise();
-		reward score = slide_left();
-		rotate_counterclockwise();
-		return score;
+	unsigned fetch_column(unsigned c) const {
+		grid x = tile >> (c << 2);
+		return (x & 0x000fu) | ((x >> 12) & 0x00f0u) | ((x >> 24) & 0x0f00u) | ((x >> 36) & 0xf000u);
+	}
+	void place_column(unsigned c, unsigned v) {
+		grid x = grid(v & 0x000fu) | (grid(v & 0x00f0u) << 12) | (grid(v & 0x0f00u) << 24) | (grid(v & 0xf000u) << 36);
+		tile = (tile & ~(grid(0x000f000f000f000full) << (c << 2))) | (x << (c << 2));
+	}
+#else
+	unsigned fetch_row(unsigned r) const {
+		return tile[r][0] | (tile[r][1] << 4) | (tile[r][2] << 8) | (tile[r][3] << 12);
+	}
+	void place_row(unsigned r, unsigned v) {
+		for (int c = 0; c < 4; c++) tile[r][c] = (v >> (c << 2)) & 0x0fu;
+	}
+	unsigned fetch_column(unsigned c) const {
+		return tile[0][c] | (tile[1][c] << 4) | (tile[2][c] << 8) | (tile[3][c] << 12);
+	}
+	void place_column(unsigned c, unsigned v) {
+		for (int r = 0; r < 4; r++) tile[r][c] = (v >> (r << 2)) & 0x0fu;
+	}
+#endif
+
+private:
+	/**
+	 * precomputed slide results of all the 65536 rows in 16-bit packed form
+	 * left slides toward the nibble (0), and right slides toward the nibble (3),
+	 * so that sliding a board up or down also works on its packed columns
+	 */
+	struct lookup {
+		struct entry {
+			uint16_t row;   // the row after sliding
+			uint16_t moved; // whether any tile of the row is moved
+			reward score;   // the reward of merging tiles
+		};
+		entry left[65536];
+		entry right[65536];
+
+		lookup() {
+			for (unsigned r = 0; r < 65536; r++) {
+				left[r] = build(r, 3);
+				right[r] = build(r, 1);
+			}
+		}
+
+		static entry build(unsigned r, unsigned opcode) {
+			board b(grid(), 0);
+			b.place_row(0, r);
+			reward score = b.slide_reference(opcode);
+			entry e;
+			e.row = b.fetch_row(0);
+			e.moved = (score != -1);
+			e.score = std::max(score, 0);
+			return e;
+		}
+
+		/**
+		 * check the table-driven slides against the reference slides
+		 * on boards whose rows (and thus columns) cover all the 65536 rows
+		 */
+		bool verify() const {
+			for (unsigned r = 0; r < 65536; r++) {
+				board b(grid(), 0);
+				for (unsigned i = 0; i < 4; i++)
+					b.place_row(i, ((r << (i << 2)) | (r >> (16 - (i << 2)))) & 0xffffu);
+				for (unsigned op = 0; op < 4; op++) {
+					board ref = b, tab = b;
+					reward s = ref.slide_reference(op);
+					reward t = -1;
+					switch (op) {
+					case 0: t = tab.slide_columns(left); break;
+					case 1: t = tab.slide_rows(right); break;
+					case 2: t = tab.slide_columns(right); break;
+					case 3: t = tab.slide_rows(left); break;
+					}
+					if (s != t || ref != tab) return false;
+				}
+			}
+			return true;
+		}
+
+		static const lookup& table() {
+			static const lookup t;
+			return t;
+		}
+	};
+
+	reward slide_rows(const lookup::entry* table) {
+		unsigned moved = 0;
+		reward score = 0;
+		for (unsigned r = 0; r < 4; r++) {
+			const lookup::entry& e = table[fetch_row(r)];
+			place_row(r, e.row);
+			moved |= e.moved;
+			score += e.score;
+		}
+		return (moved) ? score : -1;
+	}
+	reward slide_columns(const lookup::entry* table) {
+		unsigned moved = 0;
+		reward score = 0;
+		for (unsigned c = 0; c < 4; c++) {
+			const lookup::entry& e = table[fetch_column(c)];
+			place_column(c, e.row);
+			moved |= e.moved;
+			score += e.score;
+		}
+		return (moved) ? score : -1;
 	}
 
+public:
+	/**
+	 * check the slide table against the reference slides, see test.cpp
+	 */
+	static bool verify_slides() { return lookup::table().verify(); }
+
 	void rotate(int clockwise_count = 1) {
 		switch (((clockwise_count % 4) + 4) % 4) {
 		default:
@@ -184,10 +427,41 @@ public:
 		}
 	}
 
+	/**
+	 * get all the 8 isomorphisms of the board (the tiles only) at once, where
+	 * iso[0..3] are the board rotated clockwise 0..3 times, and
+	 * iso[4..7] are the horizontally reflected board rotated clockwise 0..3 times
+	 */
+	std::array<board, 8> isomorphisms() const;
+
 	void rotate_clockwise() { transpose(); reflect_horizontal(); }
 	void rotate_counterclockwise() { transpose(); reflect_vertical(); }
 	void reverse() { reflect_horizontal(); reflect_vertical(); }
 
+#if defined(THREES_PACKED_BOARD)
+	void reflect_horizontal() { tile = reflect_horizontal(tile); }
+	void reflect_vertical() { tile = reflect_vertical(tile); }
+	void transpose() { tile = transpose(tile); }
+
+	/**
+	 * branch-free transforms of a packed grid
+	 * reflect_horizontal reverses the nibbles of each 16-bit row,
+	 * reflect_vertical reverses the order of the 16-bit rows,
+	 * and transpose swaps the off-diagonal nibbles in two steps (2x2 blocks of cells, then 2x2 blocks of blocks)
+	 */
+	static grid reflect_horizontal(grid x) {
+		return ((x & 0x000f000f000f000full) << 12) | ((x & 0x00f000f000f000f0ull) << 4)
+		     | ((x & 0x0f000f000f000f00ull) >> 4) | ((x & 0xf000f000f000f000ull) >> 12);
+	}
+	static grid reflect_vertical(grid x) {
+		return (x << 48) | ((x & 0x00000000ffff0000ull) << 16)
+		     | ((x & 0x0000ffff00000000ull) >> 16) | (x >> 48);
+	}
+	static grid transpose(grid x) {
+		grid a = (x & 0xf0f00f0ff0f00f0full) | ((x & 0x0000f0f00000f0f0ull) << 12) | ((x & 0x0f0f00000f0f0000ull) >> 12);
+		return (a & 0xff00ff0000ff00ffull) | ((a & 0x00ff00ff00000000ull) >> 24) | ((a & 0x00000000ff00ff00ull) << 24);
+	}
+#else
 	void reflect_horizontal() {
 		for (int r = 0; r < 4; r++) {
 			std::swap(tile[r][0], tile[r][3]);
@@ -209,14 +483,14 @@ public:
 			}
 		}
 	}
+#endif
 
 public:
 	friend std::ostream& operator <<(std::ostream& out, const board& b) {
 		out << "+------------------------+" << std::endl;
 		for (int i = 0; i < 4; i++) {
-			auto& row = b[i];
 			out << "|" << std::dec;
-			for (auto t : row) out << std::setw(6) << itot(t);
+			for (int c = 0; c < 4; c++) out << std::setw(6) << itot(b(i * 4 + c));
 			out << "|";
 			switch (i) {
 			case 0: out << " Hint: " << "X123+"[b.hint()]; break;
@@ -230,13 +504,66 @@ public:
 	friend std::istream& operator >>(std::istream& in, board& b) {
 		for (int i = 0; i < 16; i++) {
 			while (!std::isdigit(in.peek()) && in.good()) in.ignore(1);
-			in >> b(i);
-			b(i) = ttoi(b(i));
+			cell t = 0;
+			in >> t;
+			b(i) = ttoi(t);
 		}
 		return in;
 	}
 
 private:
-	grid tile;
+	grid tile; // (cell(15):4-bit) ... (cell(1):4-bit) (cell(0):4-bit) if THREES_PACKED_BOARD is defined
 	data attr; // (#3-tile:4-bit) (#2-tile:4-bit) (#1-tile:4-bit) (last_action:4-bit) (hint_tile:4-bit)
 };
+
+/**
+ * the result of applying a slide to the board
+ * score is the reward of the slide, or -1 if the slide is illegal,
+ * in which case the afterstate is left the same as the board
+ */
+struct board::afterstate {
+	board after;
+	reward score;
+	bool legal() const { return score != -1; }
+};
+
+inline std::array<board::afterstate, 4> board::afterstates() const {
+	const lookup& table = lookup::table();
+	std::array<afterstate, 4> res = {{ { *this, 0 }, { *this, 0 }, { *this, 0 }, { *this, 0 } }};
+	unsigned moved[4] = { 0 };
+	for (unsigned i = 0; i < 4; i++) {
+		unsigned row = fetch_row(i), col = fetch_column(i);
+		const lookup::entry& u = table.left[col];
+		const lookup::entry& r = table.right[row];
+		const lookup::entry& d = table.right[col];
+		const lookup::entry& l = table.left[row];
+		res[0].after.place_column(i, u.row), res[0].score += u.score, moved[0] |= u.moved;
+		res[1].after.place_row(i, r.row), res[1].score += r.score, moved[1] |= r.moved;
+		res[2].after.place_column(i, d.row), res[2].score += d.score, moved[2] |= d.moved;
+		res[3].after.place_row(i, l.row), res[3].score += l.score, moved[3] |= l.moved;
+	}
+	for (unsigned op = 0; op < 4; op++) {
+		if (moved[op]) res[op].after.last(op);
+		else res[op].score = -1;
+	}
+	return res;
+}
+
+inline std::array<board, 8> board::isomorphisms() const {
+#if defined(THREES_PACKED_BOARD)
+	grid t = transpose(tile), h = reflect_horizontal(tile), v = reflect_vertical(tile);
+	grid th = reflect_horizontal(t), tv = reflect_vertical(t);
+	return {{
+		board(tile, attr), board(th, attr), board(reflect_vertical(h), attr), board(tv, attr),
+		board(h, attr), board(reflect_horizontal(tv), attr), board(v, attr), board(t, attr) }};
+#else
+	std::array<board, 8> iso;
+	board b = *this;
+	for (int i = 0; i < 8; i++) {
+		iso[i] = b;
+		b.rotate_clockwise();
+		if (i == 3) b.reflect_horizontal();
+	}
+	return iso;
+#endif
+}
@@ -0,0 +1,27 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * test.cpp: Self-tests of the fast paths against their reference implementations
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include "board.h"
+
+/**
+ * run a check and report its result, return whether it passes
+ */
+template<typename check>
+bool run(const char* name, check test) {
+	bool ok = test();
+	std::cout << name << ": " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+int main(int argc, const char* argv[]) {
+	bool ok = true;
+	ok &= run("slides", []() { return board::verify_slides(); });
+	return ok ? 0 : -1;
+}
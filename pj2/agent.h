@@ -19,9 +19,21 @@
 #include <climits>
 #include <limits>
 #include <stack>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <immintrin.h>
+#include <chrono>
+#include <iomanip>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "pool.h"
 
 using namespace std;
 struct state {
@@ -76,6 +88,16 @@ public:
 	}
 	virtual ~random_agent() {}
 
+	/**
+	 * reseed the engine for the (id)-th of the parallel copies of this agent,
+	 * so that each copy draws an independent but reproducible random sequence
+	 */
+	void fork(unsigned id) {
+		unsigned seed = meta.find("seed") != meta.end() ? unsigned(meta["seed"]) : 0;
+		std::seed_seq seq({ seed, id });
+		engine.seed(seq);
+	}
+
 protected:
 	std::default_random_engine engine;
 };
@@ -85,37 +107,214 @@ protected:
  */
 class weight_agent : public agent {
 public:
-	weight_agent(const std::string& args = "") : agent(args), alpha(0) {
+	weight_agent(const std::string& args = "") : agent(args), alpha(0), lambda(-1), step(1), dense(false) {
         if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+		if (meta.find("lambda") != meta.end())
+			lambda = float(meta["lambda"]);
 		if (meta.find("step") != meta.end())
-			step = int(meta["step"]);
+			step = std::max(int(meta["step"]), 1);
+		if (meta.find("format") != meta.end())
+			dense = (meta["format"].value == "dense");
 	}
 
 protected:
 	virtual void init_weights(const std::string& info) {}
+
+	/**
+	 * the weight file starts with a header describing the layout of the tables, i.e.,
+	 * (magic:32-bit) (version:32-bit) (length:32-bit) (layout:length-byte, zero-padded to 4-byte)
+	 * followed by (size:32-bit) and the tables; files without the magic are headerless
+	 *
+	 * in a quantized weight file, each table is preceded by its (scale:32-bit float)
+	 *
+	 * the tables are sparse encoded in version 2 (see basic_weight::write_sparse),
+	 * and stored as is in version 1, which can be mapped by map_weights
+	 */
+	static const uint32_t magic = 0x5457544e; // "NTWT" in little-endian
+	static const uint32_t magic_quantized = 0x5157544e; // "NTWQ" in little-endian
+	static const uint32_t version = 2;
+	static const uint32_t version_dense = 1;
+
 	virtual void load_weights(const std::string& path) {
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if (!in.is_open()) std::exit(-1);
-		uint32_t size;
-		in.read(reinterpret_cast<char*>(&size), sizeof(size));
-		net.resize(size);
-		for (weight& w : net) in >> w;
+		uint32_t head, size, ver = version_dense;
+		in.read(reinterpret_cast<char*>(&head), sizeof(head));
+		size = head;
+		if (head == magic || head == magic_quantized) {
+			uint32_t len;
+			in.read(reinterpret_cast<char*>(&ver), sizeof(ver));
+			in.read(reinterpret_cast<char*>(&len), sizeof(len));
+			if (ver != version && ver != version_dense) std::exit(-1);
+			layout.assign((len + 3) & ~3u, '\0');
+			in.read(&layout[0], layout.size());
+			layout.resize(len);
+			in.read(reinterpret_cast<char*>(&size), sizeof(size));
+		}
+		bool quantized = (head == magic_quantized);
+		bool sparse = (ver == version);
+		size_t unit = quantized ? sizeof(qweight::type) : sizeof(weight::type);
+		// scan the lengths of the tables first, so that they can be allocated in one arena
+		std::streampos begin = in.tellg();
+		std::vector<size_t> lens;
+		for (uint32_t i = 0; i < size && in; i++) {
+			uint64_t len = 0, bytes;
+			if (quantized) in.ignore(sizeof(float));
+			in.read(reinterpret_cast<char*>(&len), sizeof(len));
+			if (sparse) in.read(reinterpret_cast<char*>(&bytes), sizeof(bytes));
+			in.seekg(sparse ? bytes : len * unit, std::ios::cur);
+			lens.push_back(len);
+		}
+		if (!in) std::exit(-1);
+		in.seekg(begin);
+		if (quantized) {
+			qnet = qweight::allocate(lens);
+			qscale.resize(size);
+			for (size_t i = 0; i < qnet.size(); i++) {
+				in.read(reinterpret_cast<char*>(&qscale[i]), sizeof(float));
+				read_table(in, qnet[i], sparse);
+			}
+		} else {
+			net = weight::allocate(lens);
+			for (weight& w : net) read_table(in, w, sparse);
+		}
+		if (!in) std::exit(-1);
 		in.close();
 	}
+	/**
+	 * read a table into its allocated storage, whose (size) is already known from the scan;
+	 * the storage is zero-initialized, so a sparse table is streamed into it chunk by chunk
+	 */
+	template<typename table>
+	static void read_table(std::istream& in, table& w, bool sparse) {
+		in.ignore(sparse ? 2 * sizeof(uint64_t) : sizeof(uint64_t));
+		if (sparse) w.read_sparse(in);
+		else in.read(reinterpret_cast<char*>(w.data()), sizeof(typename table::type) * w.size());
+	}
+
 	virtual void save_weights(const std::string& path) {
-		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (net.empty() && qnet.size()) return save_quantized(path);
+		// write to a temporary file first, since the old file may still be mapped by map_weights
+		std::string temp = path + ".tmp";
+		std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
 		if (!out.is_open()) std::exit(-1);
-		uint32_t size = net.size();
-		out.write(reinterpret_cast<char*>(&size), sizeof(size));
-		for (weight& w : net) out << w;
+		write_header(out, magic);
+		for (weight& w : net) {
+			if (dense) out << w;
+			else w.write_sparse(out);
+		}
 		out.close();
+		if (!out || std::rename(temp.c_str(), path.c_str()) != 0) std::exit(-1);
+	}
+
+	/**
+	 * save the tables quantized to 16-bit integers, with a scale of (max |weight| / 32767) per table
+	 */
+	virtual void save_quantized(const std::string& path) {
+		std::string temp = path + ".tmp";
+		std::ofstream out(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) std::exit(-1);
+		write_header(out, magic_quantized);
+		for (size_t i = 0; i < std::max(net.size(), qnet.size()); i++) {
+			qweight q;
+			float scale;
+			if (net.size()) {
+				const weight& w = net[i];
+				float max = 0;
+				for (size_t j = 0; j < w.size(); j++) max = std::max(max, std::abs(w[j]));
+				scale = max > 0 ? max / 32767 : 1;
+				q = qweight(w.size());
+				for (size_t j = 0; j < w.size(); j++) q[j] = std::lround(w[j] / scale);
+			} else {
+				q = qnet[i];
+				scale = qscale[i];
+			}
+			out.write(reinterpret_cast<char*>(&scale), sizeof(scale));
+			if (dense) out << q;
+			else q.write_sparse(out);
+		}
+		out.close();
+		if (!out || std::rename(temp.c_str(), path.c_str()) != 0) std::exit(-1);
+	}
+
+	void write_header(std::ostream& out, uint32_t head) {
+		uint32_t info[] = { head, dense ? version_dense : version, uint32_t(layout.size()) };
+		out.write(reinterpret_cast<char*>(info), sizeof(info));
+		std::string text = layout;
+		text.resize((text.size() + 3) & ~size_t(3), '\0');
+		out.write(text.data(), text.size());
+		uint32_t size = std::max(net.size(), qnet.size());
+		out.write(reinterpret_cast<char*>(&size), sizeof(size));
+	}
+
+	/**
+	 * map the weight file into memory and let the tables view it directly,
+	 * so that the pages are loaded on demand instead of being read at startup
+	 *
+	 * the private mode maps the file copy-on-write, i.e., the tables can still be trained
+	 * while the file is left untouched; the shared mode maps the file read-only so that
+	 * all processes mapping the same file share a single copy in the page cache
+	 */
+	virtual void map_weights(const std::string& path, bool shared = false) {
+		int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd == -1) std::exit(-1);
+		struct stat st;
+		if (::fstat(fd, &st) != 0) std::exit(-1);
+		size_t len = st.st_size;
+		void* addr = ::mmap(nullptr, len, shared ? PROT_READ : PROT_READ | PROT_WRITE, shared ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (addr == MAP_FAILED) std::exit(-1);
+		std::shared_ptr<void> mapping(addr, [len](void* addr) { ::munmap(addr, len); });
+
+		char* base = static_cast<char*>(addr);
+		size_t pos = 0;
+		auto fetch = [&](void* dst, size_t n) {
+			if (pos + n > len) std::exit(-1);
+			std::memcpy(dst, base + pos, n);
+			pos += n;
+		};
+		uint32_t size;
+		fetch(&size, sizeof(size));
+		if (size == magic_quantized) {
+			// quantized tables are small enough to be simply loaded
+			mapping.reset();
+			return load_weights(path);
+		}
+		if (size == magic) {
+			uint32_t ver, len;
+			fetch(&ver, sizeof(ver));
+			fetch(&len, sizeof(len));
+			if (ver == version) {
+				// sparse tables cannot be viewed in place, so they are streamed instead
+				mapping.reset();
+				return load_weights(path);
+			}
+			if (ver != version_dense) std::exit(-1);
+			layout.assign((len + 3) & ~3u, '\0');
+			fetch(&layout[0], layout.size());
+			layout.resize(len);
+			fetch(&size, sizeof(size));
+		}
+		net.clear();
+		for (uint32_t i = 0; i < size; i++) {
+			uint64_t n;
+			fetch(&n, sizeof(n));
+			if (pos + n * sizeof(weight::type) > len) std::exit(-1);
+			net.emplace_back(reinterpret_cast<weight::type*>(base + pos), n, mapping);
+			pos += n * sizeof(weight::type);
+		}
 	}
 
 protected:
 	std::vector<weight> net;
+	std::vector<qweight> qnet; // the quantized tables, used instead of net for inference
+	std::vector<float> qscale;
+	std::string layout; // the description of the tables, empty if unknown
 	float alpha;
+	float lambda; // the lambda of TD(lambda), or negative to use the n-step returns
 	int step;
+	bool dense; // save the tables as is, so that the file can be mapped
 };
 
 /**
@@ -167,9 +366,9 @@ public:
 
 	virtual action take_action(const board& before, state &s) {
 		std::shuffle(opcode.begin(), opcode.end(), engine);
+		auto after = before.afterstates();
 		for (int op : opcode) {
-			board::reward reward = board(before).slide(op);
-			if (reward != -1) return action::slide(op);
+			if (after[op].legal()) return action::slide(op);
 		}
 		return action();
 	}
@@ -179,12 +378,52 @@ private:
 };
 class TDL_slider : public weight_agent {
 public:
-	TDL_slider(const std::string& args = "") : weight_agent(args), opcode({ 0, 1, 2, 3 }), space({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }) {
-		for(int i=0;i<4;i++){
-			net.emplace_back(weight(16 * 16 * 16 * 16 * 16 * 16));
+	TDL_slider(const std::string& args = "") : weight_agent(args), opcode({ 0, 1, 2, 3 }), space({ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 }),
+		depth(1), generation(0), budget(std::chrono::steady_clock::duration::zero()), aborted(false),
+		cutoff(0), nodes(0), moves(0), depths(0), quiet(false), hits(0), misses(0) {
+		if (meta.find("time") != meta.end() && int(meta["time"]) > 0) { // time=0 or less means no budget
+			budget = std::chrono::milliseconds(int(meta["time"]));
+			depth = 16; // deepen until the time runs out
+		}
+		if (meta.find("depth") != meta.end())
+			depth = std::max(int(meta["depth"]), 1);
+		if (meta.find("prob_cutoff") != meta.end())
+			cutoff = float(meta["prob_cutoff"]);
+		if (meta.find("cache") != meta.end()) {
+			size_t size = size_t(meta["cache"]);
+			while (size & (size - 1)) size &= size - 1; // round down to a power of 2
+			cache.resize(size);
+		}
+		if (meta.find("search_threads") != meta.end() && int(meta["search_threads"]) > 1)
+			threads = std::make_shared<pool>(int(meta["search_threads"]) - 1); // the caller is also a thread
+		if (depth > 1) {
+			size_t size = meta.find("tt") != meta.end() ? size_t(meta["tt"]) : size_t(1) << 16;
+			while (size & (size - 1)) size &= size - 1; // round down to a power of 2
+			table.resize(std::max(size, size_t(1)));
 		}
+		struct rusage usage[2];
+		getrusage(RUSAGE_SELF, &usage[0]);
 		if (meta.find("load") != meta.end())
 			load_weights(meta["load"]);
+		if (meta.find("load_mmap") != meta.end()) {
+			bool shared = meta.find("mmap") != meta.end() && meta["mmap"].value == "shared";
+			if (shared && alpha != 0) {
+				std::cerr << "shared mapping is read-only, set alpha=0" << std::endl;
+				std::exit(-1);
+			}
+			map_weights(meta["load_mmap"], shared);
+		}
+		if (layout.empty())
+			layout = meta.find("init") != meta.end() ? meta["init"].value : "012345,456789,5679ab,9abdef";
+		if (qnet.size() && alpha != 0) {
+			std::cerr << "quantized weights are for inference only, set alpha=0" << std::endl;
+			std::exit(-1);
+		}
+		init_weights(layout);
+		if (meta.find("quantize") != meta.end())
+			save_quantized(meta["quantize"]);
+		getrusage(RUSAGE_SELF, &usage[1]);
+		cout<<"page faults: "<<(usage[1].ru_minflt - usage[0].ru_minflt)<<" minor, "<<(usage[1].ru_majflt - usage[0].ru_majflt)<<" major\n";
 
         spaces[0] = { 12, 13, 14, 15 };
 		spaces[1] = { 0, 4, 8, 12 };
@@ -192,12 +431,109 @@ public:
 		spaces[3] = { 3, 7, 11, 15 };
 		cout<<"number of step: "<<step<<"\n";
 	}
+	virtual void open_episode(const std::string& flag = "") {
+		generation++; // invalidate the transposition table and the value cache, since the weights may have been updated
+	}
+
     virtual ~TDL_slider()
 	{
+		if (!table.empty() && moves && !quiet) {
+			std::cout << std::fixed << std::setprecision(1);
+			std::cout << "search: " << (double(nodes) / moves) << " nodes per move, ";
+			std::cout << (double(depths) / moves) << " depth per move" << std::endl;
+		}
+		if (!cache.empty() && !quiet) {
+			std::cout << std::fixed << std::setprecision(1);
+			std::cout << "cache: " << hits << " hits, " << misses << " misses";
+			std::cout << " (" << (100.0 * hits / std::max(hits + misses, uint64_t(1))) << "%)" << std::endl;
+		}
 		if (meta.find("save") != meta.end())
 			save_weights(meta["save"]);
 	}
 
+	/**
+	 * whether the tables are trained, i.e., whether the states of the episodes are needed
+	 */
+	bool learning() const { return alpha != 0; }
+
+	/**
+	 * check the kernels in use (pext and gather) against the scalar kernels on random boards,
+	 * i.e., the same indices and the same values up to the rounding of the summation order, see test.cpp
+	 */
+	bool verify_kernels() {
+		const bool fast_pext = pext, fast_gather = gather;
+		std::mt19937_64 rng(0);
+		bool ok = true;
+		for (int i = 0; i < 65536 && ok; i++) {
+			board b;
+			for (int c = 0; c < 16; c++) b(c) = rng() & 0x0fu;
+			features fast, slow;
+			pext = fast_pext;
+			extract(b, fast);
+			pext = false;
+			extract(b, slow);
+			ok = std::equal(fast.begin(), fast.begin() + 8 * tuples.size(), slow.begin());
+			gather = fast_gather;
+			float v = get_value(slow);
+			gather = false;
+			float u = get_value(slow);
+			ok = ok && std::fabs(v - u) <= 1e-4f * std::max(std::fabs(u), 1.0f);
+		}
+		pext = fast_pext;
+		gather = fast_gather;
+		return ok;
+	}
+
+	/**
+	 * make a parallel worker of this slider, which shares the tables with it
+	 * (copies of a table are shallow) and updates them without locking, i.e., Hogwild!,
+	 * while owning the other states such as the feature buffer and the search statistics;
+	 * the slider plays deterministically, so the workers need no reseeding unlike the placers
+	 *
+	 * the weights are saved by this slider only, not by the workers
+	 */
+	TDL_slider worker() const {
+		TDL_slider w(*this);
+		w.meta.erase("save");
+		w.quiet = true;
+		w.threads.reset(); // the workers search on their own threads
+		return w;
+	}
+
+	/**
+	 * copy the tables into a new arena, e.g., for the actors to play with while the tables are trained
+	 */
+	std::vector<weight> snapshot() const {
+		std::vector<size_t> lens;
+		for (const weight& w : net) lens.push_back(w.size());
+		std::vector<weight> copy = weight::allocate(lens);
+		for (size_t t = 0; t < net.size(); t++)
+			std::copy(net[t].data(), net[t].data() + net[t].size(), copy[t].data());
+		return copy;
+	}
+
+	/**
+	 * play with the given tables instead, e.g., a snapshot of another slider with the same layout
+	 */
+	void assign(const std::vector<weight>& tables) {
+		net = tables;
+		init_gather();
+		generation++; // invalidate the cached values
+	}
+
+	/**
+	 * play with a snapshot of the tables of the given slider, which may be still training,
+	 * and save the snapshot to the path, or to the path of its save= if none; since the tables
+	 * are copied without locking, the snapshot may contain a part of the updates of ongoing episodes
+	 */
+	void checkpoint(const TDL_slider& from, const std::string& path = "") {
+		assign(from.snapshot());
+		if (path.size())
+			save_weights(path);
+		else if (from.meta.find("save") != from.meta.end())
+			save_weights(from.meta.at("save"));
+	}
+
 	virtual action take_action(const board& before, state &s) 
     {   
         s.isSlider = true;
@@ -205,14 +541,15 @@ public:
 		float best_cur_val = -numeric_limits<float>::max();
 		int best_reward = -1;
 		int best_op = -1; 
+		auto after = before.afterstates();
+		std::array<float, 4> values = search(after);
 		for(int i=0;i<4;i++){
-			board tmp = board(before);
-			board::reward reward = tmp.slide(i);
-			if (reward == -1) {
+			board::reward reward = after[i].score;
+			if (reward == -1 || values[i] == -numeric_limits<float>::max()) {
 				continue;
 			}
-			float value = expectimax(tmp, i);	
-						
+			float value = values[i];
+
 			if (value + reward > best_value) {
 				best_value = value + reward;
 				best_op = i;
@@ -235,38 +572,243 @@ public:
 		
 	}
 	
-	float expectimax(const board &b, int op){
-		std::vector<int> unoccupied;
-		std::vector<int> space = spaces[op];
-		for(int i=0;i<4;i++){
-			if(b(space[i]) == 0){
-				unoccupied.push_back(space[i]);
-			} 
+	/**
+	 * the expected values of the afterstates of the 4 slides, or the lowest float if not available
+	 *
+	 * with a time budget (time=ms), the search deepens iteratively until the budget runs out
+	 * or the depth reaches the limit (depth=), and takes the values of the deepest completed
+	 * iteration; each iteration searches the slides in the order of the last iteration, so
+	 * that an interrupted iteration is still used if the last best slide has been searched,
+	 * in which case only the slides searched by the interrupted iteration are considered
+	 */
+	std::array<float, 4> search(const std::array<board::afterstate, 4>& after) {
+		const float none = -numeric_limits<float>::max();
+		std::array<float, 4> values;
+		values.fill(none);
+		moves++;
+		aborted = false;
+		if (budget == std::chrono::steady_clock::duration::zero()) {
+			search(after, { 0, 1, 2, 3 }, depth, values);
+			depths += depth;
+			return values;
 		}
-		int total = unoccupied.size();
 
-		int bag[3], num = 0;
-		for (board::cell t = 1; t <= 3; t++)
-			for (size_t i = 0; i < b.bag(t); i++)
-				bag[num++] = t;
+		deadline = std::chrono::steady_clock::now() + budget;
+		int reached = 0;
+		std::array<int, 4> order = { 0, 1, 2, 3 };
+		for (int d = 1; d <= depth && !aborted; d++) {
+			std::array<float, 4> next;
+			next.fill(none);
+			search(after, order, d, next); // the first iteration is never interrupted
+			if (aborted && next[order[0]] == none) break;
+			values = next;
+			reached = d;
+			std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+				return after[a].score + values[a] > after[b].score + values[b];
+			});
+		}
+		depths += reached;
+		return values;
+	}
 
-		std::shuffle(bag, bag + num, engine);
-		board::cell tile = b.hint();
-		board::cell hint = bag[--num];
+	/**
+	 * search the legal slides (order) to (depth), and keep the values of the completed ones
+	 * the slides are split among the threads (search_threads=) if available, i.e., the root split
+	 */
+	void search(const std::array<board::afterstate, 4>& after, const std::array<int, 4>& order, int depth, std::array<float, 4>& values) {
+		auto root = [&](int i) {
+			float low;
+			float value = expectimax(after[i].after, i, depth, 1, low);
+			if (!__atomic_load_n(&aborted, __ATOMIC_RELAXED)) values[i] = value;
+		};
+		if (threads) {
+			std::vector<pool::task> tasks;
+			for (int i : order) {
+				if (after[i].legal()) tasks.emplace_back([&root, i]() { root(i); });
+			}
+			threads->run(tasks);
+		} else {
+			for (int i : order) {
+				if (!after[i].legal()) continue;
+				root(i);
+				if (aborted) break;
+			}
+		}
+	}
+
+	/**
+	 * a placement the placer may make on an afterstate, with its probability
+	 */
+	struct outcome {
+		int pos;
+		board::cell tile;
+		board::cell hint;
+		float prob;
+	};
+	static const int max_outcomes = 4 * 3 * 3;
+
+	/**
+	 * enumerate all the placements the placer may make on an afterstate, in the order of
+	 * (pos, tile, hint): an empty cell on the edge opposite to the slide (op), each with equal
+	 * probability; the hint tile, or a tile drawn from the bag if there is no hint; and the next
+	 * hint drawn from the rest of the bag, where each tile is drawn with probability bag(tile) / |bag|
+	 *
+	 * returns the number of placements
+	 */
+	int placements(const board& b, int op, outcome* out) const {
+		int pos[4], num_pos = 0;
+		for (int p : spaces[op]) {
+			if (b(p) == 0) pos[num_pos++] = p;
+		}
+		int n = 0;
+		for (int i = 0; i < num_pos; i++) {
+			unsigned bag[4] = { 0, b.bag(1), b.bag(2), b.bag(3) };
+			for (board::cell tile = 1; tile <= 3; tile++) {
+				unsigned size = bag[1] + bag[2] + bag[3];
+				if (b.hint() ? tile != b.hint() : bag[tile] == 0) continue;
+				float prob = b.hint() ? 1.0f / num_pos : float(bag[tile]) / size / num_pos;
+				if (b.hint() == 0) bag[tile]--, size--;
+				for (board::cell hint = 1; hint <= 3; hint++) {
+					if (bag[hint] == 0) continue;
+					out[n++] = { pos[i], tile, hint, prob * bag[hint] / size };
+				}
+				if (b.hint() == 0) bag[tile]++;
+			}
+		}
+		return n;
+	}
+
+	/**
+	 * the expected value of an afterstate searched (depth) placements ahead, i.e., the average of
+	 * the best (reward + expected value searched (depth - 1) placements ahead) after each placement,
+	 * weighted by the exact probabilities of the placements
+	 *
+	 * for a search deeper than one placement, the values are kept in the transposition table during
+	 * an episode, since the same afterstates are often reached by different paths and later moves
+	 *
+	 * since the pruning (prob_cutoff=) depends on the probability to reach the afterstate (reach),
+	 * only the values without any pruned branch are kept, each with the lowest probability of its
+	 * branches relative to the afterstate (low, or 0 if pruned), and a kept value is reused only if
+	 * none of its branches would be pruned with the current reach, so that the value of an
+	 * afterstate does not depend on the path to it or on the size of the table
+	 */
+	float expectimax(const board& b, int op, int depth, float reach, float& low) {
+		low = 1;
+		if (table.empty()) return expectimax(b, op);
+		uint64_t key = hash(pack(b), b.info());
+		float cached;
+		if (lookup(key, depth, reach, cached, low)) return cached;
+		if (depth > 1 && budget != std::chrono::steady_clock::duration::zero() && std::chrono::steady_clock::now() >= deadline)
+			__atomic_store_n(&aborted, true, __ATOMIC_RELAXED);
+		if (__atomic_load_n(&aborted, __ATOMIC_RELAXED)) return 0; // the value is discarded by search
+		if (depth <= 1) {
+			float value = expectimax(b, op);
+			store(key, depth, value, low);
+			return value;
+		}
+		__atomic_fetch_add(&nodes, 1, __ATOMIC_RELAXED);
+
+		outcome out[max_outcomes];
+		int n = placements(b, op, out);
+		float best[max_outcomes];
+		float lowest[max_outcomes];
+		auto child = [&](int i) {
+			board tmp = board(b);
+			tmp.place(out[i].pos, out[i].tile, out[i].hint);
+			auto after = tmp.afterstates();
+			best[i] = -std::numeric_limits<float>::max();
+			// a branch which is too unlikely to be reached (prob_cutoff=) takes the static values
+			// of its afterstates instead of being searched further
+			float p = reach * out[i].prob;
+			lowest[i] = p < cutoff ? 0 : 1;
+			float value[4] = { 0 };
+			if (p < cutoff) {
+				board leaf[4];
+				float leaf_val[4];
+				int num = 0;
+				for (int j = 0; j < 4; j++) {
+					if (after[j].score != -1) leaf[num++] = after[j].after;
+				}
+				get_values(leaf, num, leaf_val);
+				for (int j = 0, k = 0; j < 4; j++) {
+					if (after[j].score != -1) value[j] = leaf_val[k++];
+				}
+			}
+			for (int j = 0; j < 4; j++) {
+				if (after[j].score == -1) continue;
+				float v = value[j], l = 1;
+				if (p >= cutoff) v = expectimax(after[j].after, j, depth - 1, p, l);
+				lowest[i] = std::min(lowest[i], l);
+				best[i] = std::max(best[i], after[j].score + v);
+			}
+		};
+		// the placements are searched in parallel if possible, but always summed up in order,
+		// so that the value does not depend on the number of threads
+		if (threads) {
+			std::vector<pool::task> tasks;
+			for (int i = 0; i < n; i++) tasks.emplace_back([&child, i]() { child(i); });
+			threads->run(tasks);
+		} else {
+			for (int i = 0; i < n; i++) child(i);
+		}
 		float sum = 0.0;
+		for (int i = 0; i < n; i++) {
+			low = std::min(low, out[i].prob * lowest[i]);
+			if (best[i] == -std::numeric_limits<float>::max()) continue;
+			sum += out[i].prob * best[i];
+		}
+
+		if (__atomic_load_n(&aborted, __ATOMIC_RELAXED)) return 0;
+		if (low > 0) store(key, depth, sum, low);
+		return sum;
+	}
+
+	/**
+	 * the expected value of an afterstate, i.e., the average of the best (reward + value) after
+	 * each placement, weighted by the exact probabilities of the placements
+	 *
+	 * the value of a leaf afterstate does not depend on the hint, so the placements which differ
+	 * only in the hint are merged before their children are evaluated
+	 */
+	float expectimax(const board &b, int op){
+		__atomic_fetch_add(&nodes, 1, __ATOMIC_RELAXED);
+		outcome out[max_outcomes];
+		int n = placements(b, op, out);
 
-		for(int i : unoccupied){
+		// collect all the legal leaf afterstates first, so that they can be evaluated in one batch
+		board leaf[4 * max_outcomes];
+		board::reward leaf_reward[4 * max_outcomes];
+		float leaf_val[4 * max_outcomes];
+		float prob[max_outcomes];
+		int num_leaf[max_outcomes], m = 0, l = 0;
+		for(int i = 0; i < n; i++){
+			if(m && out[i].pos == out[i - 1].pos && out[i].tile == out[i - 1].tile){
+				prob[m - 1] += out[i].prob;
+				continue;
+			}
 			board tmp = board(b);
-			tmp.place(i, tile, hint);
+			tmp.place(out[i].pos, out[i].tile, out[i].hint);
+			auto after = tmp.afterstates();
+			prob[m] = out[i].prob;
+			num_leaf[m] = 0;
+			for(int j=0;j<4;j++){
+				if(after[j].score == -1) continue;
+				leaf[l] = after[j].after;
+				leaf_reward[l++] = after[j].score;
+				num_leaf[m]++;
+			}
+			m++;
+		}
+		get_values(leaf, l, leaf_val);
+
+		float sum = 0.0;
+		for(int g = 0, l = 0; g < m; g++){
 			board::reward best_reward = -1;
 			float best_val = -std::numeric_limits<float>::max();
 
-			for(int j=0;j<4;j++){
-				board tmp_after = board(tmp);
-				board::reward reward = tmp_after.slide(j);
-				if(reward == -1) continue;
-				
-				float val = get_value(tmp_after);
+			for(int end = l + num_leaf[g]; l < end; l++){
+				board::reward reward = leaf_reward[l];
+				float val = leaf_val[l];
 				if(reward + val > best_reward + best_val) {
 					best_reward = reward;
 					best_val = val;
@@ -275,76 +817,465 @@ public:
 
 			if(best_reward == -1){
 				continue;
-			}		
-			sum += (best_val + best_reward) / float(total);
+			}
+			sum += prob[g] * (best_val + best_reward);
 		}
 
 		return sum;
 	}
 
-	float get_value(const board &b){
-		float val = 0.0;
-		board tmp = board(b);
-		// isomorphism * 8 (rotate + reflect)
-		for(int i=0;i<2;i++){
-			for(int j=0;j<4;j++){
-				val += net[0][encode6(tmp, 0, 1, 2, 3, 4, 5)];
-				val += net[1][encode6(tmp, 4, 5, 6, 7, 8, 9)];
-				val += net[2][encode6(tmp, 5, 6, 7, 9, 10, 11)];
-				val += net[3][encode6(tmp, 9, 10, 11, 13, 14, 15)];
+	/**
+	 * an entry of the transposition table, i.e., the expected value of an afterstate searched
+	 * (depth) placements ahead, which is valid only in the episode of the same generation
+	 *
+	 * the entry is (check:64-bit) (generation:16-bit) (low:8-bit) (depth:8-bit) (value:32-bit float),
+	 * where the check is the xor of the hash of the afterstate and the rest, so that the table is
+	 * shared by the threads without locking: an entry torn by concurrent stores simply fails the check
+	 *
+	 * the lowest probability of the branches (low) is kept as k for a lower bound 2^(-k/8), with
+	 * a margin for the rounding of the probabilities multiplied in a different order
+	 */
+	struct entry {
+		uint64_t check;
+		uint64_t data;
+	};
 
-				tmp.rotate_clockwise();
+	bool lookup(uint64_t key, int depth, float reach, float& value, float& low) const {
+		const entry& e = table[key & (table.size() - 1)];
+		uint64_t check = __atomic_load_n(&e.check, __ATOMIC_RELAXED);
+		uint64_t data = __atomic_load_n(&e.data, __ATOMIC_RELAXED);
+		if ((check ^ data) != key || ((data >> 32) & 0xffff00ffu) != tag(depth)) return false;
+		float lowest = std::exp2(-float((data >> 40) & 0xff) / 8);
+		if (reach * lowest < cutoff) return false; // some branches would be pruned with this reach
+		uint32_t bits = uint32_t(data);
+		std::memcpy(&value, &bits, sizeof(value));
+		low = lowest;
+		return true;
+	}
+	void store(uint64_t key, int depth, float value, float low) {
+		entry& e = table[key & (table.size() - 1)];
+		uint32_t k = 0; // the lowest probability does not matter without pruning
+		if (cutoff > 0) {
+			k = std::floor(-8 * std::log2(low)) + 2;
+			if (k > 0xff) return; // too unlikely to be reused
+		}
+		uint32_t bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		uint64_t data = (uint64_t(tag(depth) | (k << 8)) << 32) | bits;
+		__atomic_store_n(&e.check, key ^ data, __ATOMIC_RELAXED);
+		__atomic_store_n(&e.data, data, __ATOMIC_RELAXED);
+	}
+	uint32_t tag(int depth) const {
+		return ((generation & 0xffff) << 16) | (depth & 0xff);
+	}
+
+	/**
+	 * the tiles of a board as a 64-bit integer, where the nibble (i) is the tile at cell (i)
+	 */
+	static uint64_t pack(const board& b) {
+#if defined(THREES_PACKED_BOARD)
+		return board(b);
+#else
+		uint64_t tiles = 0;
+		for (int i = 0; i < 16; i++) tiles |= uint64_t(b(i)) << (4 * i);
+		return tiles;
+#endif
+	}
+	static uint64_t hash(uint64_t tiles, board::data attr) {
+		uint64_t h = (tiles ^ (attr * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull;
+		return h ^ (h >> 32);
+	}
+
+	/**
+	 * the feature indices of a board, where feature (k * tuples.size() + t)
+	 * is the index of tuple (t) on the k-th isomorphism of the board
+	 */
+	static const int max_tuples = 16;
+	static const int max_tuple_size = 7;
+	typedef std::array<uint32_t, 8 * max_tuples> features;
+
+	void extract(const board& b, features& idx) const {
+#if defined(THREES_PACKED_BOARD)
+		if (pext) return extract_bmi2(b, idx);
+#endif
+		const int n = tuples.size();
+		for (int t = 0; t < n; t++) {
+			switch (tuples[t].size) {
+			case 4: encode<4>(b, tuples[t], &idx[t], n); break;
+			case 5: encode<5>(b, tuples[t], &idx[t], n); break;
+			case 6: encode<6>(b, tuples[t], &idx[t], n); break;
+			default: encode_n(b, tuples[t], &idx[t], n); break;
+			}
+		}
+	}
+
+#if defined(THREES_PACKED_BOARD)
+	/**
+	 * BMI2 kernel of extract, which takes each index with a single pext
+	 *
+	 * the index of a tuple puts its first cell at the highest nibble, while pext puts the lowest
+	 * nibble first; since the nibbles of a packed board in reverse order form the board rotated
+	 * by 180 degrees, which is also one of the isomorphisms, the k-th isomorphism is extracted
+	 * from the isomorphism rotated by 180 degrees with the reversed mask of the tuple, as long as
+	 * the cells of the tuple are in ascending order
+	 */
+	__attribute__((target("bmi2")))
+	void extract_bmi2(const board& b, features& idx) const {
+		static const int rotate180[8] = { 2, 3, 0, 1, 6, 7, 4, 5 };
+		const int n = tuples.size();
+		std::array<board, 8> iso = b.isomorphisms();
+		for (int k = 0; k < 8; k++) {
+			const board::grid& raw = iso[rotate180[k]];
+			for (int t = 0; t < n; t++) {
+				idx[k * n + t] = _pext_u64(raw, tuples[t].mask);
+			}
+		}
+	}
+#endif
+
+	float get_value(const features& idx){
+		if (qnet.size()) return gather ? get_value_avx2_quantized(idx) : get_value_quantized(idx);
+		if (gather) return get_value_avx2(idx);
+		const int n = tuples.size();
+		float val = 0.0;
+		for(int k=0;k<8;k++){
+			for(int t=0;t<n;t++){
+				val += net[t][idx[k * n + t]];
 			}
-			tmp.reflect_horizontal();
 		}
 		return val;
 	}
 
-    int encode6(const board& board, int a, int b, int c, int d, int e, int f){
-        return (board(a) << 20) | (board(b) << 16) | (board(c) << 12) | (board(d) << 8) | (board(e) << 4) | (board(f) << 0);
+	float get_value(const board &b){
+		features idx;
+		extract(b, idx);
+		return get_value(idx);
 	}
 
-	void adjust_weight(const board& b, float target){
-		board tmp = board(b);
+	/**
+	 * evaluate n boards together: extract the features and issue the prefetches of all
+	 * the boards before summing any of them, so that their cache misses overlap
+	 */
+	void get_values(const board* b, size_t n, float* out){
+		const size_t batch = 16;
+		features idx[batch];
+		for(size_t i = 0; i < n; i += batch){
+			size_t m = std::min(batch, n - i);
+			if (cache.size()) {
+				get_values_cached(b + i, m, out + i);
+				continue;
+			}
+			for(size_t j = 0; j < m; j++){
+				extract(b[i + j], idx[j]);
+				prefetch(idx[j]);
+			}
+			for(size_t j = 0; j < m; j++){
+				out[i + j] = get_value(idx[j]);
+			}
+		}
+	}
 
-		for(int i=0;i<2;i++){
-			for(int j=0;j<4;j++){
-				net[0][encode6(tmp, 0, 1, 2, 3, 4, 5)] += target;
-				net[1][encode6(tmp, 4, 5, 6, 7, 8, 9)] += target;
-				net[2][encode6(tmp, 5, 6, 7, 9, 10, 11)] += target;
-				net[3][encode6(tmp, 9, 10, 11, 13, 14, 15)] += target;
+	/**
+	 * get_values of up to 16 boards through the value cache (cache=), i.e., a direct-mapped table
+	 * of the values of the recently evaluated afterstates keyed by their tiles, where only the
+	 * missed boards are evaluated together; the entries are shared by the threads without locking
+	 * in the same way as the transposition table, and are tagged with the generation of the weights
+	 */
+	void get_values_cached(const board* b, size_t n, float* out){
+		features idx[16];
+		size_t slot[16], miss = 0;
+		uint64_t keys[16];
+		for(size_t j = 0; j < n; j++){
+			uint64_t key = hash(pack(b[j]), 0);
+			const entry& e = cache[key & (cache.size() - 1)];
+			uint64_t check = __atomic_load_n(&e.check, __ATOMIC_RELAXED);
+			uint64_t data = __atomic_load_n(&e.data, __ATOMIC_RELAXED);
+			if ((check ^ data) == key && (data >> 32) == generation) {
+				uint32_t bits = uint32_t(data);
+				std::memcpy(&out[j], &bits, sizeof(float));
+				continue;
+			}
+			extract(b[j], idx[miss]);
+			prefetch(idx[miss]);
+			keys[miss] = key;
+			slot[miss++] = j;
+		}
+		for(size_t j = 0; j < miss; j++){
+			float value = out[slot[j]] = get_value(idx[j]);
+			entry& e = cache[keys[j] & (cache.size() - 1)];
+			uint32_t bits;
+			std::memcpy(&bits, &value, sizeof(bits));
+			uint64_t data = (uint64_t(generation) << 32) | bits;
+			__atomic_store_n(&e.check, keys[j] ^ data, __ATOMIC_RELAXED);
+			__atomic_store_n(&e.data, data, __ATOMIC_RELAXED);
+		}
+		__atomic_fetch_add(&hits, n - miss, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&misses, miss, __ATOMIC_RELAXED);
+	}
 
-				tmp.rotate_clockwise();
+	/**
+	 * AVX2 kernel of get_value, which fetches 8 weights per gather by indexing all the tables
+	 * from the base of the first table, i.e., feature (f) reads base[offset[f] + idx[f]]
+	 */
+	__attribute__((target("avx2")))
+	float get_value_avx2(const features& idx) const {
+		const float* base = net[0].data();
+		const int num = 8 * tuples.size();
+		__m256 sum = _mm256_setzero_ps();
+		for (int f = 0; f < num; f += 8) {
+			__m256i index = _mm256_add_epi32(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&idx[f])),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&offset[f])));
+			sum = _mm256_add_ps(sum, _mm256_i32gather_ps(base, index, 4));
+		}
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_add_ss(half, _mm_movehdup_ps(half));
+		return _mm_cvtss_f32(half);
+	}
+
+	/**
+	 * get_value on the quantized tables, i.e., the sum of (value * scale) of all the features
+	 */
+	float get_value_quantized(const features& idx) const {
+		const int n = tuples.size();
+		float val = 0.0;
+		for(int k=0;k<8;k++){
+			for(int t=0;t<n;t++){
+				val += qnet[t][idx[k * n + t]] * qscale[t];
+			}
+		}
+		return val;
+	}
+
+	/**
+	 * AVX2 kernel of get_value_quantized, which gathers 32-bit words at 16-bit granularity
+	 * and keeps their lower halves, i.e., the 16-bit values at the indices
+	 */
+	__attribute__((target("avx2")))
+	float get_value_avx2_quantized(const features& idx) const {
+		const int* base = reinterpret_cast<const int*>(qnet[0].data());
+		const int num = 8 * tuples.size();
+		__m256 sum = _mm256_setzero_ps();
+		for (int f = 0; f < num; f += 8) {
+			__m256i index = _mm256_add_epi32(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&idx[f])),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&offset[f])));
+			__m256i value = _mm256_srai_epi32(_mm256_slli_epi32(_mm256_i32gather_epi32(base, index, 2), 16), 16);
+			__m256 scale = _mm256_loadu_ps(&feature_scale[f]);
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_cvtepi32_ps(value), scale));
+		}
+		__m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+		half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+		half = _mm_add_ss(half, _mm_movehdup_ps(half));
+		return _mm_cvtss_f32(half);
+	}
+
+	void prefetch(const features& idx) const {
+		const int n = tuples.size();
+		for(int k=0;k<8;k++){
+			for(int t=0;t<n;t++){
+				if (qnet.size()) __builtin_prefetch(&qnet[t][idx[k * n + t]]);
+				else __builtin_prefetch(&net[t][idx[k * n + t]]);
+			}
+		}
+	}
+
+	void adjust_weight(const features& idx, float target){
+		const int n = tuples.size();
+		for(int k=0;k<8;k++){
+			for(int t=0;t<n;t++){
+				net[t][idx[k * n + t]] += target;
 			}
-			tmp.reflect_horizontal();
 		}
 	}
 
+	void adjust_weight(const board& b, float target){
+		features idx;
+		extract(b, idx);
+		adjust_weight(idx, target);
+	}
+
+	/**
+	 * train the afterstates of an episode backwards in a single pass, towards either
+	 * the n-step returns (step=n) or the lambda-returns (lambda=x), both of which are
+	 * maintained incrementally, i.e., the rewards in the window of n steps are kept as a
+	 * running sum, and G(i) = r(i+1) + (1 - lambda) V(i+1) + lambda G(i+1)
+	 *
+	 * each afterstate is evaluated right before its update, and the value after the update
+	 * is approximated by value + alpha * error for the target of the previous afterstate,
+	 * which is inexact if the afterstate has repeated features (e.g., a symmetric board);
+	 * with step>1, the intermediate updates also change the shared features, so the
+	 * target of an n-step return is evaluated again instead of using the approximation
+	 */
 	void update_value(std::vector<state>& v) {
-		float final_alpha = alpha / 32;
-		for(int i = v.size() - 1 ; i >= 0 ; i--){
-			board::reward total_reward = 0;
-			float error;
-			bool flag = false;
-			for(int j = 1 ; j <= step ; j++){
-				if(i + j >= int(v.size())){
-					error = total_reward + 0 - get_value(v[i].after);
-					flag = true;
-					break;
-				} 
-				total_reward += v[i + j].reward;
+		if (alpha == 0) return;
+		const int len = v.size();
+		float final_alpha = alpha / (8 * tuples.size());
+		// extract the features of each afterstate only once
+		feats.resize(len);
+		vals.resize(len);
+		for(int i = 0; i < len; i++){
+			extract(v[i].after, feats[i]);
+		}
+		float window = 0; // the sum of r(i+1) ... r(i+step)
+		float lambda_return = 0; // the lambda-return of the last afterstate is 0
+		for(int i = len - 1; i >= 0; i--){
+			float target;
+			if (lambda >= 0) {
+				if (i + 1 < len) lambda_return = v[i + 1].reward + (1 - lambda) * vals[i + 1] + lambda * lambda_return;
+				target = lambda_return;
+			} else {
+				if (i + 1 < len) window += v[i + 1].reward;
+				if (i + 1 + step < len) window -= v[i + 1 + step].reward;
+				if (i + step < len) target = window + (step > 1 ? get_value(feats[i + step]) : vals[i + step]);
+				else target = window;
 			}
+			float value = get_value(feats[i]);
+			float error = target - value;
+			adjust_weight(feats[i], final_alpha * error);
+			vals[i] = value + alpha * error;
+		}
+		generation++; // invalidate the cached values, since the weights have been updated
+	}
+protected:
+	/**
+	 * an n-tuple pattern expanded into the cell lists of its 8 isomorphisms
+	 */
+	struct tuple {
+		int size;
+		std::array<std::array<int, max_tuple_size>, 8> iso;
+		uint64_t mask; // the nibbles of the reversed cells, i.e., cell (c) at nibble (15 - c)
+		bool ascending; // whether the cells are in ascending order
+	};
+
+	/**
+	 * initialize the tuples from the layout, i.e., comma-separated patterns
+	 * with one hex digit per cell such as "012345,456789,5679ab,9abdef",
+	 * and allocate a table of 16^size weights for each pattern if not loaded yet
+	 */
+	virtual void init_weights(const std::string& info) {
+		board identity;
+		for (int i = 0; i < 16; i++) identity(i) = i;
+		std::array<board, 8> iso = identity.isomorphisms();
 
-			if(!flag){
-				error = total_reward + get_value(v[i + step].after) - get_value(v[i].after);
+		std::stringstream ss(info);
+		for (std::string pattern; std::getline(ss, pattern, ','); ) {
+			tuple tp;
+			tp.size = pattern.size();
+			tp.mask = 0;
+			tp.ascending = true;
+			if (tp.size < 1 || tp.size > max_tuple_size || int(tuples.size()) >= max_tuples) {
+				std::cerr << "unsupported tuple pattern: " << pattern << std::endl;
+				std::exit(-1);
 			}
-			adjust_weight(v[i].after, final_alpha * error);
+			for (int c = 0; c < tp.size; c++) {
+				if (!std::isxdigit(pattern[c]) || pattern.find(pattern[c]) != size_t(c)) {
+					std::cerr << "unsupported tuple pattern: " << pattern << std::endl;
+					std::exit(-1);
+				}
+				int cell = std::stoi(pattern.substr(c, 1), nullptr, 16);
+				for (int k = 0; k < 8; k++) tp.iso[k][c] = iso[k](cell);
+				tp.mask |= uint64_t(0x0f) << ((15 - cell) * 4);
+				if (c && cell < tp.iso[0][c - 1]) tp.ascending = false;
+			}
+			tuples.push_back(tp);
+		}
+		if (net.empty() && qnet.empty()) {
+			std::vector<size_t> lens;
+			for (const tuple& tp : tuples) lens.push_back(size_t(1) << (4 * tp.size));
+			net = weight::allocate(lens);
 		}
+		auto table_size = [&](size_t t) { return qnet.size() ? qnet[t].size() : net[t].size(); };
+		if (std::max(net.size(), qnet.size()) != tuples.size()) {
+			std::cerr << "mismatched tuple layout: " << info << std::endl;
+			std::exit(-1);
+		}
+		for (size_t t = 0; t < tuples.size(); t++) {
+			if (table_size(t) != (size_t(1) << (4 * tuples[t].size))) {
+				std::cerr << "mismatched tuple layout: " << info << std::endl;
+				std::exit(-1);
+			}
+		}
+
+		init_gather();
+
+		// use the pext kernel if the CPU supports BMI2 and the cells of all the tuples are ascending
+		pext = false;
+#if defined(THREES_PACKED_BOARD)
+		bool simd = !(meta.find("simd") != meta.end() && int(meta["simd"]) == 0);
+		pext = __builtin_cpu_supports("bmi2") && simd;
+		for (const tuple& tp : tuples) pext = pext && tp.ascending;
+#endif
 	}
+
+	/**
+	 * use the gather kernel if the CPU supports AVX2 and all the tables are reachable
+	 * from the first table with 32-bit indices, e.g., allocated in the same arena or mapping
+	 */
+	void init_gather() {
+		// the tables in use, either the float tables or the quantized tables
+		auto table_size = [&](size_t t) { return qnet.size() ? qnet[t].size() : net[t].size(); };
+		auto table_data = [&](size_t t) { return qnet.size() ? reinterpret_cast<const char*>(qnet[t].data()) : reinterpret_cast<const char*>(net[t].data()); };
+		size_t unit = qnet.size() ? sizeof(qweight::type) : sizeof(weight::type);
+		bool simd = !(meta.find("simd") != meta.end() && int(meta["simd"]) == 0);
+		gather = __builtin_cpu_supports("avx2") && simd;
+		for (size_t t = 0; t < tuples.size() && gather; t++) {
+			ptrdiff_t diff = (table_data(t) - table_data(0)) / ptrdiff_t(unit);
+			if (diff < INT_MIN || diff + ptrdiff_t(table_size(t)) > INT_MAX) gather = false;
+			for (int k = 0; k < 8; k++) {
+				offset[k * tuples.size() + t] = diff;
+				feature_scale[k * tuples.size() + t] = qnet.size() ? qscale[t] : 1;
+			}
+		}
+	}
+
+	/**
+	 * write the indices of a tuple on all the 8 isomorphisms to idx[0], idx[stride], ...
+	 */
+	template<int N>
+	static void encode(const board& b, const tuple& tp, uint32_t* idx, int stride) {
+		for (int k = 0; k < 8; k++) {
+			const std::array<int, max_tuple_size>& p = tp.iso[k];
+			uint32_t index = 0;
+			for (int c = 0; c < N; c++) index = (index << 4) | b(p[c]);
+			idx[k * stride] = index;
+		}
+	}
+	static void encode_n(const board& b, const tuple& tp, uint32_t* idx, int stride) {
+		for (int k = 0; k < 8; k++) {
+			const std::array<int, max_tuple_size>& p = tp.iso[k];
+			uint32_t index = 0;
+			for (int c = 0; c < tp.size; c++) index = (index << 4) | b(p[c]);
+			idx[k * stride] = index;
+		}
+	}
+
 private:
 	std::array<int, 4> opcode;
 	std::vector<int> space;
-    std::default_random_engine engine;
     std::vector<int> spaces[4];
+	std::vector<tuple> tuples;
+	std::vector<features> feats;
+	std::vector<float> vals; // the approximate values of the afterstates after their updates
+	std::array<int32_t, 8 * max_tuples> offset; // the offset of the table of each feature from the first table
+	std::array<float, 8 * max_tuples> feature_scale; // the scale of the quantized table of each feature
+	bool gather;
+	bool pext;
+	int depth; // the number of placements to search ahead
+	std::vector<entry> table; // the transposition table, whose size is a power of 2
+	uint32_t generation; // the generation of the valid entries of the transposition table
+	std::chrono::steady_clock::duration budget; // the time budget of a move, or zero if none
+	std::chrono::steady_clock::time_point deadline;
+	bool aborted; // whether the time budget has run out during the search
+	float cutoff; // the reach probability below which a branch is not searched further
+	uint64_t nodes; // the number of chance nodes searched
+	uint64_t moves; // the number of moves searched
+	uint64_t depths; // the sum of the search depths of the moves
+	bool quiet; // whether the search statistics are not shown, e.g., by a worker
+	std::shared_ptr<pool> threads; // the threads to search in parallel, or null if none
+	std::vector<entry> cache; // the values of the afterstates, whose size is a power of 2
+	uint64_t hits; // the number of values found in the cache
+	uint64_t misses; // the number of values evaluated and stored in the cache
 };
 
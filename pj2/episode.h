@@ -31,6 +31,17 @@ public:
 	void open_episode(const std::string& tag) {
 		ep_open = { tag, millisec() };
 	}
+	/**
+	 * reset to an empty episode, but keep the storage of the moves for the next episode
+	 */
+	void clear() {
+		ep_state = initial_state();
+		ep_score = 0;
+		ep_moves.clear();
+		ep_time = 0;
+		ep_open = {};
+		ep_close = {};
+	}
 	void close_episode(const std::string& tag) {
 		ep_close = { tag, millisec() };
 	}
@@ -0,0 +1,91 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * pool.h: Thread pool for parallel search
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <vector>
+
+/**
+ * a pool of threads running tasks, where the thread waiting for its tasks keeps running
+ * the pending tasks meanwhile, so that a task may run nested tasks without deadlock
+ *
+ * the idle threads take the oldest tasks, which are usually the largest ones near the root,
+ * while the waiting threads take the newest tasks, which are usually their own children
+ */
+class pool {
+public:
+	typedef std::function<void()> task;
+
+	pool(size_t threads) : stop(false) {
+		for (size_t i = 0; i < threads; i++) workers.emplace_back([this]() { loop(); });
+	}
+	~pool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stop = true;
+		}
+		wake.notify_all();
+		for (std::thread& th : workers) th.join();
+	}
+
+	/**
+	 * run all the tasks and return after all of them are done
+	 */
+	void run(std::vector<task>& tasks) {
+		std::atomic<size_t> left(tasks.size());
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (task& t : tasks) queue.emplace_back([&left, &t]() { t(); left--; });
+		}
+		wake.notify_all();
+		while (left) {
+			if (!help()) std::this_thread::yield();
+		}
+	}
+
+	size_t size() const { return workers.size() + 1; }
+
+private:
+	bool help() {
+		task t;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (queue.empty()) return false;
+			t = std::move(queue.back());
+			queue.pop_back();
+		}
+		t();
+		return true;
+	}
+	void loop() {
+		while (true) {
+			task t;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [this]() { return stop || queue.size(); });
+				if (queue.empty()) return;
+				t = std::move(queue.front());
+				queue.pop_front();
+			}
+			t();
+		}
+	}
+
+private:
+	std::vector<std::thread> workers;
+	std::deque<task> queue;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stop;
+};
@@ -9,6 +9,7 @@
 
 #pragma once
 #include <deque>
+#include <vector>
 #include <algorithm>
 #include <iostream>
 #include <sstream>
@@ -47,6 +48,8 @@ public:
 	 * where
 	 * '1000': current index
 	 * 'avg = 282, max = 2325': the average score is 282, the maximum score is 2325
+	 *                         'diff = -3' follows if compared against a reference run (see compare),
+	 *                         i.e., the average score minus that of the same games in the reference run
 	 * 'ops = 1346086 (2840867|955796)': the average speed is 1346086
 	 *                                   the average speed of the slider is 2840867
 	 *                                   the average speed of the placer is 955796
@@ -78,6 +81,10 @@ public:
 		std::cout << std::fixed << std::setprecision(0);
 		std::cout << count << "\t";
 		std::cout << "avg = " << (sum / num) << ", ";
+		if (count <= baseline.size()) {
+			board::score ref = std::accumulate(baseline.begin() + (count - num), baseline.begin() + count, board::score(0));
+			std::cout << "diff = " << std::showpos << (double(sum) - double(ref)) / num << std::noshowpos << ", ";
+		}
 		std::cout << "max = " << (max) << ", ";
 		std::cout << "ops = " << (sop * 1000.0 / sdu);
 		std::cout <<     " (" << (pop * 1000.0 / pdu);
@@ -101,13 +108,29 @@ public:
 		show(true, data.size());
 	}
 
+	/**
+	 * compare against a reference run of the same games in the same order, e.g., the same network
+	 * evaluated with float weights and the same --place seed, so that the difference is shown in
+	 * each block against the same range of the reference games
+	 */
+	void compare(const statistics& ref) {
+		baseline.clear();
+		for (const episode& ep : ref.data) baseline.push_back(ep.score());
+	}
+
 	bool is_finished() const {
 		return count >= total;
 	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
+		if (count++ >= limit) {
+			// reuse the dropped episode, so that its storage does not need to be allocated again
+			data.push_back(std::move(data.front()));
+			data.pop_front();
+			data.back().clear();
+		} else {
+			data.emplace_back();
+		}
 		data.back().open_episode(flag);
 	}
 
@@ -116,6 +139,23 @@ public:
 		if (count % block == 0) show();
 	}
 
+	/**
+	 * append an episode played elsewhere, e.g., by a parallel worker, and leave an empty episode
+	 * in its place, which reuses the storage of the dropped episode if any
+	 */
+	void add_episode(episode& ep) {
+		if (count++ >= limit) {
+			data.push_back(std::move(ep));
+			ep = std::move(data.front());
+			data.pop_front();
+			ep.clear();
+		} else {
+			data.push_back(std::move(ep));
+			ep = episode();
+		}
+		if (count % block == 0) show();
+	}
+
 	episode& at(size_t i) {
 		return data.at(i);
 	}
@@ -148,5 +188,6 @@ private:
 	size_t block;
 	size_t limit;
 	size_t count;
+	std::vector<board::score> baseline; // the scores of the reference run, or empty if none
 	std::deque<episode> data;
 };
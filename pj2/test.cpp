@@ -0,0 +1,44 @@
+/**
+ * Framework for Threes! and its variants (C++ 11)
+ * test.cpp: Self-tests of the fast paths against their reference implementations
+ *
+ * Author: Theory of Computer Games
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <random>
+#include "board.h"
+#include "agent.h"
+
+/**
+ * run a check and report its result, return whether it passes
+ */
+template<typename check>
+bool run(const char* name, check test) {
+	bool ok = test();
+	std::cout << name << ": " << (ok ? "ok" : "FAILED") << std::endl;
+	return ok;
+}
+
+/**
+ * a slider with random weights, so that the kernels are checked on nonzero values
+ */
+class noisy_slider : public TDL_slider {
+public:
+	noisy_slider(const std::string& args) : TDL_slider(args) {
+		std::mt19937 rng(0);
+		std::uniform_real_distribution<float> value(-1, 1);
+		for (weight& w : net)
+			for (size_t i = 0; i < w.size(); i++) w[i] = value(rng);
+	}
+};
+
+int main(int argc, const char* argv[]) {
+	bool ok = true;
+	ok &= run("slides", []() { return board::verify_slides(); });
+	noisy_slider slide("init=01234,4567,89abc,048c");
+	ok &= run("kernels", [&]() { return slide.verify_kernels(); });
+	return ok ? 0 : -1;
+}
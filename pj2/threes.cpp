@@ -11,20 +11,111 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <iomanip>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistics.h"
 
+/**
+ * play an episode until it ends, and collect the states of the slider for training
+ * returns the winner
+ */
+agent& play(TDL_slider& slide, random_placer& place, episode& game, vector<state>& vs) {
+	while (true) {
+		state s;
+		s.before = game.state();
+		agent& who = game.take_turns(slide, place);
+		action move = who.take_action(game.state(), s);
+//		std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
+		if (game.apply_action(move) != true) break;
+		s.after = game.state();
+
+		if (who.check_for_win(game.state())) break;
+		if (s.isSlider) {
+			vs.push_back(s);
+		}
+	}
+	return game.last_turns(slide, place);
+}
+
+/**
+ * play an episode until it ends without collecting anything, i.e., for evaluation only
+ * returns the winner
+ */
+agent& play(TDL_slider& slide, random_placer& place, episode& game) {
+	state s;
+	while (true) {
+		agent& who = game.take_turns(slide, place);
+		action move = who.take_action(game.state(), s);
+		if (game.apply_action(move) != true) break;
+		if (who.check_for_win(game.state())) break;
+	}
+	return game.last_turns(slide, place);
+}
+
+/**
+ * the record of an episode played by an actor, i.e., the episode and the states for training
+ */
+struct record {
+	size_t id;
+	episode game;
+	vector<state> vs;
+};
+
+/**
+ * a blocking queue of limited capacity, which passes the records from the actors to the learner
+ */
+template<typename type>
+class bounded_queue {
+public:
+	bounded_queue(size_t capacity) : capacity(capacity) {}
+
+	void push(type&& item) {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_full.wait(lock, [&]() { return items.size() < capacity; });
+		items.push_back(std::move(item));
+		not_empty.notify_one();
+	}
+	type pop() {
+		std::unique_lock<std::mutex> lock(mutex);
+		not_empty.wait(lock, [&]() { return items.size() > 0; });
+		type item = std::move(items.front());
+		items.pop_front();
+		not_full.notify_one();
+		return item;
+	}
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return items.size();
+	}
+
+private:
+	size_t capacity;
+	std::deque<type> items;
+	std::mutex mutex;
+	std::condition_variable not_full, not_empty;
+};
+
 int main(int argc, const char* argv[]) {
 	std::cout << "Threes! Demo: ";
 	std::copy(argv, argv + argc, std::ostream_iterator<const char*>(std::cout, " "));
 	std::cout << std::endl << std::endl;
 
-	size_t total = 1000, block = 0, limit = 0;
+	size_t total = 1000, block = 0, limit = 0, threads = 1;
+	size_t actors = 0, refresh = 100;
+	size_t checkpoint = 0, eval_games = 1000;
 	std::string slide_args, place_args;
-	std::string load_path, save_path;
+	std::string load_path, save_path, baseline_path, eval_path, checkpoint_path;
 	for (int i = 1; i < argc; i++) {
 		std::string arg = argv[i];
 		auto match_arg = [&](std::string flag) -> bool {
@@ -49,6 +140,22 @@ int main(int argc, const char* argv[]) {
 			load_path = next_opt();
 		} else if (match_arg("save")) {
 			save_path = next_opt();
+		} else if (match_arg("baseline")) {
+			baseline_path = next_opt();
+		} else if (match_arg("threads")) {
+			threads = std::stoull(next_opt());
+		} else if (match_arg("actors")) {
+			actors = std::stoull(next_opt());
+		} else if (match_arg("refresh")) {
+			refresh = std::max(std::stoull(next_opt()), 1ull);
+		} else if (match_arg("checkpoint-save")) {
+			checkpoint_path = next_opt();
+		} else if (match_arg("checkpoint")) {
+			checkpoint = std::stoull(next_opt());
+		} else if (match_arg("eval-games")) {
+			eval_games = std::stoull(next_opt());
+		} else if (match_arg("eval-save")) {
+			eval_path = next_opt();
 		}
 	}
 
@@ -61,10 +168,176 @@ int main(int argc, const char* argv[]) {
 		if (stats.is_finished()) stats.summary();
 	}
 
+	if (baseline_path.size()) {
+		statistics baseline(0);
+		std::ifstream in(baseline_path, std::ios::in);
+		in >> baseline;
+		in.close();
+		stats.compare(baseline);
+	}
+
     TDL_slider slide(slide_args);
 	random_placer place(place_args);
 	vector<state> vs;
 
+	// every (checkpoint) episodes, a background thread saves a snapshot of the network and evaluates
+	// the snapshot with (eval_games) games, while the training goes on; the snapshot is saved to
+	// (checkpoint_path), or to the save= of the slider if not given, and the statistics are saved to
+	// (eval_path), where "{}" in either path is replaced by the number of episodes trained
+	auto numbered = [](std::string path, size_t n) -> std::string {
+		size_t at = path.find("{}");
+		return at != std::string::npos ? path.replace(at, 2, std::to_string(n)) : path;
+	};
+	std::atomic<size_t> trained(stats.step());
+	std::atomic<bool> training(true);
+	std::unique_ptr<TDL_slider> frozen; // only with checkpoints, since it copies the tables of the search
+	if (checkpoint) frozen.reset(new TDL_slider(slide.worker()));
+	std::thread checkpointer;
+	if (checkpoint) checkpointer = std::thread([&]() {
+		while (true) {
+			size_t due = (trained / checkpoint + 1) * checkpoint;
+			while (training && trained < due) std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			if (trained < due) break;
+			frozen->checkpoint(slide, numbered(checkpoint_path, due));
+			if (eval_path.empty()) continue;
+
+			// evaluate with the same games every time, so that the results are comparable
+			random_placer place_e(place_args);
+			statistics result(eval_games, eval_games + 1); // too large a block to show anything
+			while (!result.is_finished()) {
+				frozen->open_episode("~:" + place_e.name());
+				place_e.open_episode(frozen->name() + ":~");
+				result.open_episode(frozen->name() + ":" + place_e.name());
+				agent& win = play(*frozen, place_e, result.back());
+				result.close_episode(win.name());
+				frozen->close_episode(win.name());
+				place_e.close_episode(win.name());
+			}
+			std::ofstream out(numbered(eval_path, due), std::ios::out | std::ios::trunc);
+			out << result;
+			out.close();
+		}
+	});
+
+	// each worker plays with its own slider and placer, and merges its episodes into the statistics
+	// the sliders of the workers (and of the actors below) are copied from the slider on this thread
+	// before any thread starts, since the slider is not safe to copy while it is being trained
+	std::mutex stats_lock;
+	std::atomic<size_t> next(stats.step());
+	std::vector<TDL_slider> sliders;
+	sliders.reserve(std::max(threads, actors)); // the sliders are never copied again once built
+	auto worker = [&](unsigned id) {
+		TDL_slider& slide_w = sliders[id];
+		random_placer place_w(place_args);
+		place_w.fork(id);
+		vector<state> vs;
+		episode game;
+		while (next++ < total) {
+			slide_w.open_episode("~:" + place_w.name());
+			place_w.open_episode(slide_w.name() + ":~");
+
+			game.open_episode(slide_w.name() + ":" + place_w.name());
+			agent& win = slide_w.learning() ? play(slide_w, place_w, game, vs) : play(slide_w, place_w, game);
+			game.close_episode(win.name());
+			slide_w.update_value(vs);
+			vs.clear();
+			slide_w.close_episode(win.name());
+			place_w.close_episode(win.name());
+
+			std::lock_guard<std::mutex> lock(stats_lock);
+			stats.add_episode(game);
+			trained++;
+		}
+	};
+	std::vector<std::thread> pool;
+	for (unsigned id = 0; !actors && threads > 1 && id < threads; id++) sliders.push_back(slide.worker());
+	for (unsigned id = 0; id < sliders.size(); id++) pool.emplace_back(worker, id);
+	for (std::thread& th : pool) th.join();
+	pool.clear();
+	sliders.clear();
+
+	// alternatively, the actors play with snapshots of the network, and the learner trains the network
+	// with their episodes in order; the (n)-th episode is played with the seed (n) and the snapshot taken
+	// after learning (n / refresh - 1) * refresh episodes, so the result does not depend on the scheduling
+	typedef std::shared_ptr<const std::vector<weight>> snapshot;
+	std::map<size_t, snapshot> snapshots; // the latest two versions
+	std::mutex snapshot_lock;
+	std::condition_variable snapshot_ready;
+	bounded_queue<record> queue(4 * actors);
+	size_t first = stats.step();
+	std::atomic<size_t> played(0);
+	auto actor = [&](unsigned id) {
+		TDL_slider& slide_a = sliders[id];
+		random_placer place_a(place_args);
+		size_t version = -1;
+		for (size_t n; (n = next++) < total; ) {
+			size_t want = std::max((n - first) / refresh, size_t(1)) - 1;
+			if (want != version) {
+				std::unique_lock<std::mutex> lock(snapshot_lock);
+				snapshot_ready.wait(lock, [&]() { return snapshots.count(want); });
+				slide_a.assign(*snapshots[want]);
+				version = want;
+			}
+			place_a.fork(n);
+			slide_a.open_episode("~:" + place_a.name());
+			place_a.open_episode(slide_a.name() + ":~");
+
+			record rec;
+			rec.id = n;
+			rec.game.open_episode(slide_a.name() + ":" + place_a.name());
+			agent& win = play(slide_a, place_a, rec.game, rec.vs);
+			rec.game.close_episode(win.name());
+			slide_a.close_episode(win.name());
+			place_a.close_episode(win.name());
+			queue.push(std::move(rec));
+			played++;
+		}
+	};
+	if (actors) {
+		snapshots[0] = std::make_shared<const std::vector<weight>>(slide.snapshot());
+		for (unsigned id = 0; id < actors; id++) sliders.push_back(slide.worker());
+		for (unsigned id = 0; id < actors; id++) pool.emplace_back(actor, id);
+
+		typedef std::chrono::steady_clock clock;
+		size_t every = block ? block : total, depth = 0, depth_max = 0, pops = 0;
+		clock::time_point since = clock::now();
+		clock::duration busy = clock::duration::zero();
+		std::map<size_t, record> pending; // reorder the records by their ids
+		for (size_t n = first; n < total; ) {
+			size_t size = queue.size();
+			depth += size, depth_max = std::max(depth_max, size), pops++;
+			record rec = queue.pop();
+			pending.emplace(rec.id, std::move(rec));
+			for (auto it = pending.begin(); it != pending.end() && it->first == n; it = pending.erase(it), n++) {
+				clock::time_point start = clock::now();
+				slide.update_value(it->second.vs);
+				if ((n + 1 - first) % refresh == 0) {
+					snapshot snap = std::make_shared<const std::vector<weight>>(slide.snapshot());
+					std::lock_guard<std::mutex> lock(snapshot_lock);
+					snapshots[(n + 1 - first) / refresh] = snap;
+					if (snapshots.size() > 2) snapshots.erase(snapshots.begin());
+					snapshot_ready.notify_all();
+				}
+				busy += clock::now() - start;
+				stats.add_episode(it->second.game);
+				trained++;
+
+				if (stats.step() % every == 0) {
+					double wall = std::chrono::duration<double>(clock::now() - since).count();
+					double learn = std::chrono::duration<double>(busy).count();
+					std::cout << std::fixed << std::setprecision(1);
+					std::cout << "\t" << "queue = " << (double(depth) / pops) << " (" << depth_max << "), ";
+					std::cout << std::setprecision(0);
+					std::cout << "actors = " << (played.exchange(0) / wall) << "/s, ";
+					std::cout << "learner = " << (every / std::max(learn, 1e-6)) << "/s" << std::endl;
+					since = clock::now(), busy = clock::duration::zero();
+					depth = depth_max = pops = 0;
+				}
+			}
+		}
+		for (std::thread& th : pool) th.join();
+	}
+
 	while (!stats.is_finished()) {
 //		std::cerr << "======== Game " << stats.step() << " ========" << std::endl;
 		slide.open_episode("~:" + place.name());
@@ -72,28 +345,18 @@ int main(int argc, const char* argv[]) {
 
 		stats.open_episode(slide.name() + ":" + place.name());
 		episode& game = stats.back();
-		while (true) {
-			state s;
-			s.before = game.state();
-			agent& who = game.take_turns(slide, place);
-			action move = who.take_action(game.state(), s);
-//			std::cerr << game.state() << "#" << game.step() << " " << who.name() << ": " << move << std::endl;
-			if (game.apply_action(move) != true) break;
-			s.after = game.state();		
-
-			if (who.check_for_win(game.state())) break;
-			if (s.isSlider) {
-				vs.push_back(s);
-			}
-		}
-		agent& win = game.last_turns(slide, place);
+		agent& win = slide.learning() ? play(slide, place, game, vs) : play(slide, place, game);
 		stats.close_episode(win.name());
 		slide.update_value(vs);
     	vs.clear();
 		slide.close_episode(win.name());
 		place.close_episode(win.name());
+		trained++;
 	}
 
+	training = false;
+	if (checkpointer.joinable()) checkpointer.join();
+
 	if (save_path.size()) {
 		std::ofstream out(save_path, std::ios::out | std::ios::trunc);
 		out << stats;
@@ -1,6 +1,5 @@
 ./threes --total=0 --slide="save=weights.bin" # generate a clean network
-for i in {1..100}; do
-	./threes --total=100000 --block=1000 --limit=1000 --slide="load=weights.bin save=weights.bin alpha=0.003125" | tee -a train.log
-	./threes --total=1000 --slide="load=weights.bin alpha=0" --save="stats.txt"
-	tar zcvf weights.$(date +%Y%m%d-%H%M%S).tar.gz weights.bin train.log stats.txt
-done
\ No newline at end of file
+# train for 10M games in a single process with a single learner; every 100k games, keep a snapshot
+# of the weights in weights.<games>.bin and its statistics over 1000 games in stats.<games>.txt
+./threes --total=10000000 --block=1000 --limit=1000 --checkpoint=100000 --checkpoint-save="weights.{}.bin" \
+	--eval-games=1000 --eval-save="stats.{}.txt" --slide="load=weights.bin save=weights.bin alpha=0.003125" | tee -a train.log
\ No newline at end of file
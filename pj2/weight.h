@@ -11,39 +11,162 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
 
-class weight {
+/**
+ * a weight table is a view of (len) values in some storage,
+ * which is either allocated by the table itself or provided externally (e.g., a mapped file)
+ *
+ * note that copies of a table share the same storage, use clone() for a deep copy
+ */
+template<typename value_t>
+class basic_weight {
 public:
-	typedef float type;
+	typedef value_t type;
 
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	basic_weight() : value(nullptr), length(0) {}
+	basic_weight(size_t len) : value(nullptr), length(len) {
+		// allocate a spare value so that a wider load at the last index stays in bounds
+		std::shared_ptr<type> data(new type[len + 1](), std::default_delete<type[]>());
+		value = data.get();
+		storage = data;
+	}
+	basic_weight(type* value, size_t len, std::shared_ptr<void> storage) : value(value), length(len), storage(storage) {}
+	basic_weight(basic_weight&& f) = default;
+	basic_weight(const basic_weight& f) = default;
 
-	weight& operator =(const weight& f) = default;
+	basic_weight& operator =(basic_weight&& f) = default;
+	basic_weight& operator =(const basic_weight& f) = default;
 	type& operator[] (size_t i) { return value[i]; }
 	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	size_t size() const { return length; }
+	type* data() { return value; }
+	const type* data() const { return value; }
+
+	/**
+	 * allocate tables of the given lengths from one contiguous arena, which is aligned to
+	 * a 2M-byte boundary and advised to be backed by huge pages, with each table aligned
+	 * to a cache line; fall back to separately allocated tables if the arena is unavailable
+	 */
+	static std::vector<basic_weight> allocate(const std::vector<size_t>& lens) {
+		const size_t line = 64, huge = size_t(2) << 20;
+		std::vector<size_t> offset;
+		size_t total = 0;
+		for (size_t len : lens) {
+			offset.push_back(total);
+			total += (len * sizeof(type) + line - 1) & ~(line - 1);
+		}
+		std::vector<basic_weight> tables;
+		size_t bytes = total + line + huge;
+		void* addr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED) {
+			for (size_t len : lens) tables.emplace_back(len);
+			return tables;
+		}
+		std::shared_ptr<void> arena(addr, [bytes](void* addr) { ::munmap(addr, bytes); });
+		char* base = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(addr) + huge - 1) & ~(huge - 1));
+#if defined(MADV_HUGEPAGE)
+		::madvise(base, total, MADV_HUGEPAGE); // simply use normal pages if it fails
+#endif
+		for (size_t i = 0; i < lens.size(); i++)
+			tables.emplace_back(reinterpret_cast<type*>(base + offset[i]), lens[i], arena);
+		return tables;
+	}
+
+	basic_weight clone() const {
+		basic_weight w(length);
+		std::copy(value, value + length, w.value);
+		return w;
+	}
+
+	/**
+	 * the sparse encoding of a table is (size:64-bit) (bytes:64-bit) followed by (bytes) of chunks,
+	 * each of which is (zeros:32-bit) (count:32-bit) (values:count), i.e., a run of zeros followed
+	 * by a run of literal values, since most entries of a trained table are never visited
+	 *
+	 * the literal run absorbs short gaps of zeros, which are cheaper to store than a new chunk
+	 */
+	void write_sparse(std::ostream& out) const {
+		const size_t gap = 2 * sizeof(uint32_t) / sizeof(type) + 1;
+		std::vector<uint32_t> chunks; // (zeros, count) pairs
+		uint64_t bytes = 0;
+		for (size_t i = 0; i < length; ) {
+			size_t head = i;
+			while (head < length && zero(value[head])) head++;
+			size_t tail = head; // one past the last literal value
+			for (size_t j = head; j < length && j - tail < gap; j++)
+				if (!zero(value[j])) tail = j + 1;
+			chunks.push_back(head - i);
+			chunks.push_back(tail - head);
+			bytes += 2 * sizeof(uint32_t) + (tail - head) * sizeof(type);
+			i = tail;
+		}
+		uint64_t size = length;
+		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
+		out.write(reinterpret_cast<const char*>(&bytes), sizeof(uint64_t));
+		size_t pos = 0;
+		for (size_t i = 0; i < chunks.size(); i += 2) {
+			pos += chunks[i];
+			out.write(reinterpret_cast<const char*>(&chunks[i]), 2 * sizeof(uint32_t));
+			out.write(reinterpret_cast<const char*>(value + pos), sizeof(type) * chunks[i + 1]);
+			pos += chunks[i + 1];
+		}
+	}
+	/**
+	 * read the chunks of a sparse encoded table, whose (size) and (bytes) have been consumed
+	 * only the literal values are written, so the table should be zero-initialized beforehand
+	 */
+	void read_sparse(std::istream& in) {
+		for (size_t pos = 0; pos < length && in; ) {
+			uint32_t chunk[2];
+			in.read(reinterpret_cast<char*>(chunk), sizeof(chunk));
+			if (chunk[0] + chunk[1] == 0 || pos + chunk[0] + chunk[1] > length) {
+				in.setstate(std::ios::failbit);
+				break;
+			}
+			pos += chunk[0];
+			in.read(reinterpret_cast<char*>(value + pos), sizeof(type) * chunk[1]);
+			pos += chunk[1];
+		}
+	}
 
 public:
-	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+	friend std::ostream& operator <<(std::ostream& out, const basic_weight& w) {
+		uint64_t size = w.size();
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		out.write(reinterpret_cast<const char*>(w.data()), sizeof(type) * size);
 		return out;
 	}
-	friend std::istream& operator >>(std::istream& in, weight& w) {
-		auto& value = w.value;
+	friend std::istream& operator >>(std::istream& in, basic_weight& w) {
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
-		value.resize(size);
-		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
+		w = basic_weight(size);
+		in.read(reinterpret_cast<char*>(w.data()), sizeof(type) * size);
 		return in;
 	}
 
 protected:
-	std::vector<type> value;
+	static bool zero(const type& v) {
+		// compare the bits so that a negative zero is kept as a literal
+		static const type none = type();
+		return std::memcmp(&v, &none, sizeof(type)) == 0;
+	}
+
+protected:
+	type* value;
+	size_t length;
+	std::shared_ptr<void> storage;
 };
+
+typedef basic_weight<float> weight;
+
+/**
+ * quantized weight table for inference, where each weight is stored as
+ * a 16-bit integer and scaled by a factor shared by the whole table
+ */
+typedef basic_weight<int16_t> qweight;